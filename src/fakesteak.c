@@ -1,13 +1,19 @@
-#include <stdio.h>      // fprintf(), stdout, setlinebuf()
+#include <stdio.h>      // fprintf(), stdout, setlinebuf(), fopen(), fgets()
 #include <stdlib.h>     // EXIT_SUCCESS, EXIT_FAILURE, rand()
+#include <string.h>     // strcmp(), strlen(), memset(), strerror()
 #include <stdint.h>     // uint8_t, uint16_t, ...
 #include <inttypes.h>   // PRIu8, PRIu16, ...
 #include <unistd.h>     // getopt(), STDOUT_FILENO
 #include <math.h>       // ceil()
-#include <time.h>       // time(), nanosleep(), struct timespec
-#include <signal.h>     // sigaction(), struct sigaction
+#include <time.h>       // time(), nanosleep(), clock_gettime(), struct timespec
+#include <signal.h>     // sigaction(), struct sigaction, raise()
 #include <termios.h>    // struct winsize, struct termios, tcgetattr(), ...
+#include <fcntl.h>      // open(), O_CREAT, O_WRONLY, ...
+#include <errno.h>      // errno, EINTR
+#include <pthread.h>    // pthread_create(), pthread_mutex_lock(), ...
+#include <poll.h>       // poll(), struct pollfd
 #include <sys/ioctl.h>  // ioctl(), TIOCGWINSZ
+#include <sys/mman.h>   // shm_open(), mmap(), munmap()
 
 // program information
 
@@ -46,6 +52,33 @@
 #define SPEED_FACTOR_MAX 100
 #define SPEED_FACTOR_DEF 10
 
+#define SCENARIO_COLS_DEF   80
+#define SCENARIO_ROWS_DEF   24
+#define SCENARIO_FRAMES_DEF 1000
+#define SCENARIO_EVENTS_MAX 256
+#define SCENARIO_CELLS_MAX  (4096 * 4096)
+
+// where to look for the Linux powercap RAPL energy counters
+
+#ifndef RAPL_PATH
+#define RAPL_PATH "/sys/class/powercap"
+#endif
+#define RAPL_DOMAINS_MAX 8
+#define RAPL_SAMPLE_SECS 1
+
+// size of the heatmap tiles, in cells, and number of frames per heatmap
+
+#define HEATMAP_TILE_COLS 8
+#define HEATMAP_TILE_ROWS 4
+#define HEATMAP_FRAMES    100
+
+// how far behind (in bytes) a recording may fall before frames get dropped,
+// and the size of the shared memory ring buffer's data area
+
+#define SINK_BACKLOG_MAX (8 * 1024 * 1024)
+#define SHM_RING_SIZE    (4 * 1024 * 1024)
+#define SHM_RING_MAGIC   "FAKESTK1"
+
 // do not change these 
 
 #define ANSI_FONT_RESET "\x1b[0m"
@@ -56,6 +89,8 @@
 #define ANSI_SHOW_CURSOR "\x1b[?25h"
 
 #define ANSI_CLEAR_SCREEN "\x1b[2J"
+#define ANSI_ALT_SCREEN_ON  "\x1b[?1049h"
+#define ANSI_ALT_SCREEN_OFF "\x1b[?1049l"
 #define ANSI_CURSOR_RESET "\x1b[H"
 
 #define BITMASK_ASCII 0x00FF
@@ -73,6 +108,23 @@
 #define ASCII_MAX 126
 
 #define NS_PER_SEC 1000000000
+#define US_PER_SEC 1000000
+#define UJ_PER_J   1000000
+
+#define HASH_SPAWN 1
+#define HASH_TSIZE 2
+#define HASH_ASCII 3
+#define HASH_PHASE 4
+
+#define SINK_TTY  1
+#define SINK_FILE 2
+#define SINK_SHM  3
+#define SINKS_MAX 3
+
+#define EVENT_RESIZE 1
+#define EVENT_DROPS  2
+#define EVENT_ERROR  3
+#define EVENT_WINCH  4
 
 // for easy access of colors later on
 
@@ -88,11 +140,33 @@ static char *colors[] =
 
 #define NUM_COLORS sizeof(colors) / sizeof(colors[0])
 
+// names of the scenario events, indexed by EVENT_* type
+
+static char *event_names[] =
+{
+	NULL,
+	"resize",
+	"drops",
+	"error",
+	"winch"
+};
+
+#define NUM_EVENT_NAMES sizeof(event_names) / sizeof(event_names[0])
+
 // these are flags used for signal handling
 
 static volatile int resized;   // window resize event received
 static volatile int running;   // controls running of the main loop 
 
+// terminal attributes from before cli_setup(), restored by cli_reset()
+
+static struct termios tattr;
+static int tattr_saved;
+
+// number of matrix (re)allocations, reported in scenario mode
+
+static size_t num_allocs;
+
 //
 //  the matrix' data represents a 2D array of size cols * rows.
 //  every data element is a 16 bit int which stores information
@@ -119,18 +193,173 @@ typedef struct matrix
 }
 matrix_s;
 
+//
+//  the heatmap is a diagnostic aid that accumulates, per tile of cells, how
+//  many cells changed from one frame to the next (and hence would have to be
+//  rewritten) and how many bytes mat_print() spent on them. every 
+//  HEATMAP_FRAMES frames, the per-frame averages are written to a file.
+//
+
+typedef struct heatmap
+{
+	const char *file;   // file to write the heatmap to
+	uint16_t *prev;     // cell values of the previous frame
+	uint32_t *writes;   // number of changed cells, per tile
+	uint32_t *bytes;    // number of bytes printed, per tile
+	uint16_t  mcols;    // number of matrix columns
+	uint16_t  cols;     // number of tile columns
+	uint16_t  rows;     // number of tile rows
+	uint32_t  frames;   // number of frames accumulated so far
+	uint32_t  compared; // number of those that had a previous frame
+	uint8_t   primed;   // prev holds the previous frame (not so after init)
+	uint64_t  first;    // number of the first accumulated frame
+}
+heatmap_s;
+
+//
+//  every frame is encoded only once, into the output's buffer, and then 
+//  handed to all sinks. the tty sink writes it to stdout right away. the 
+//  file sink appends it, as a timestamped asciicast v2 event, to its own 
+//  backlog, which a separate thread writes to disk, so that a slow disk 
+//  never stalls the display; if the backlog 
+//  grows beyond SINK_BACKLOG_MAX, frames are dropped instead. the shm sink 
+//  copies it into a ring buffer in shared memory, where it is available to
+//  other processes until it gets overwritten. as the frames contain no line
+//  breaks, the header also holds the size of the matrix. 
+//
+//  the header is guarded by a sequence counter (seqlock): it is odd while 
+//  the writer is updating the ring, even otherwise. readers read seq (and 
+//  retry while it is odd), then the header fields and the frame data, and
+//  then seq again; if it changed, the copy may be torn and must be retried.
+//
+
+typedef struct ring
+{
+	char     magic[8];  // SHM_RING_MAGIC, identifies the format
+	uint64_t size;      // size of the data area, in bytes
+	uint64_t seq;       // sequence counter, odd while writing
+	uint32_t cols;      // number of columns of the frames
+	uint32_t rows;      // number of rows of the frames
+	uint64_t head;      // total number of bytes written so far
+	uint64_t last;      // value of head where the latest frame starts
+	uint64_t frames;    // number of frames written so far
+	char     data[];    // the ring buffer itself, data[head % size]
+}
+ring_s;
+
+typedef struct sink
+{
+	uint8_t   type;     // one of the SINK_* types
+	int       fd;       // file descriptor (file sink)
+	char     *buf;      // backlog not yet handed to the writer (file sink)
+	size_t    len;      // number of bytes in buf
+	size_t    cap;      // capacity of buf
+	size_t    dropped;  // number of frames dropped
+	int       err;      // first write error (errno), if any (file sink)
+	double    start;    // time the recording started (file sink)
+	uint8_t   done;     // tells the writer thread to finish (file sink)
+	ring_s   *ring;     // mapped ring buffer (shm sink)
+	const char *name;   // file or shared memory object name
+	pthread_t       thread;
+	pthread_mutex_t lock;
+	pthread_cond_t  cond;
+}
+sink_s;
+
+typedef struct output
+{
+	char    *buf;               // the encoded frame
+	size_t   len;               // number of bytes in buf
+	size_t   cap;               // capacity of buf
+	sink_s   sinks[SINKS_MAX];  // the sinks every frame is written to
+	uint8_t  num_sinks;         // number of sinks in use
+}
+output_s;
+
 typedef struct options
 {
 	uint8_t speed;         // speed factor
 	uint8_t drops;         // drops ratio / factor
 	uint8_t error;         // error ratio / factor
 	time_t  rands;         // seed for rand()
+	char   *scenario;      // scenario file to replay headless
+	char   *heatmap;       // file to write the heatmap to
+	char   *record;        // file to record the output to
+	char   *shm;           // name of the shared memory ring buffer
+	uint64_t frame;        // frame to start at (seekable mode)
 	uint8_t bg : 1;        // use background color
+	uint8_t energy : 1;    // print energy usage on exit
+	uint8_t seekable : 1;  // compute frames directly from the seed
+	uint8_t saver : 1;     // screensaver mode
 	uint8_t help : 1;      // show help and exit
 	uint8_t version : 1;   // show version and exit
 }
 options_s;
 
+//
+//  a scenario is a list of events that get replayed, headless and without 
+//  any delay between frames, in order to benchmark the otherwise hard to 
+//  reproduce situations like resize storms or parameter changes. 
+//  scenario files are plain text, one directive per line:
+//
+//  size 80x24            initial matrix size (default: 80x24)
+//  frames 1000           number of frames to run (default: 1000)
+//  at 10 resize 120x40   at frame 10, resize the matrix to 120x40
+//  at 20 drops 50        at frame 20, change the drops ratio to 50
+//  at 30 error 5         at frame 30, change the error ratio to 5
+//  at 40 winch 20        at frame 40, send SIGWINCH to ourselves 20 times
+//
+//  empty lines and lines starting with '#' are ignored. events have to be
+//  given in order of their frame number.
+//
+
+typedef struct event
+{
+	uint32_t frame;     // frame at which the event is triggered
+	uint8_t  type;      // one of the EVENT_* types
+	uint16_t arg1;      // first argument (width, ratio or count)
+	uint16_t arg2;      // second argument (height for resize)
+	double   latency;   // duration of the event's frame, in seconds
+	size_t   allocs;    // matrix (re)allocations during that frame
+	double   stamp;     // time at which the event's frame began
+	uint64_t energy;    // energy counter when the event's frame began
+}
+event_s;
+
+typedef struct scenario
+{
+	event_s  events[SCENARIO_EVENTS_MAX];
+	size_t   num_events;  // number of events in the events array
+	size_t   next_event;  // index of the next event to trigger
+	uint32_t frames;      // number of frames to run
+	uint16_t cols;        // initial number of columns
+	uint16_t rows;        // initial number of rows
+	double   stamp;       // time at which the replay began
+	uint64_t energy;      // energy counter when the replay began
+}
+scenario_s;
+
+//
+//  the RAPL (running average power limit) counters, exposed by the Linux 
+//  powercap framework, report the energy used by each CPU package (domain) 
+//  in microjoules. they wrap around at max_energy_range_uj, hence we keep 
+//  track of the last reading and accumulate the differences ourselves, 
+//  reading them often enough (every RAPL_SAMPLE_SECS) to never miss a wrap.
+//  only the package domains are used, as others (like psys) overlap them.
+//  note that the counters are usually only readable by root.
+//
+
+typedef struct rapl
+{
+	uint64_t last[RAPL_DOMAINS_MAX];   // last counter reading per domain
+	uint64_t range[RAPL_DOMAINS_MAX];  // wrap around value per domain
+	uint8_t  index[RAPL_DOMAINS_MAX];  // powercap index (intel-rapl:N) per domain
+	uint64_t total;                    // accumulated energy, in microjoules
+	double   sampled;                  // time of the last reading
+	uint8_t  domains;                  // number of readable domains
+}
+rapl_s;
+
 /*
  * Parse command line args into the provided options_s struct.
  */
@@ -139,28 +368,53 @@ parse_args(int argc, char **argv, options_s *opts)
 {
 	opterr = 0;
 	int o;
-	while ((o = getopt(argc, argv, "bd:e:hr:s:V")) != -1)
+	while ((o = getopt(argc, argv, "bcd:e:Ef:hH:m:o:P:r:s:SV")) != -1)
 	{
 		switch (o)
 		{
 			case 'b':
 				opts->bg = 1;
 				break;
+			case 'c':
+				opts->seekable = 1;
+				break;
 			case 'd':
 				opts->drops = atoi(optarg);
 				break;
 			case 'e':
 				opts->error = atoi(optarg);
 				break;
+			case 'E':
+				opts->energy = 1;
+				break;
+			case 'f':
+				opts->frame = strtoull(optarg, NULL, 10);
+				opts->seekable = 1;
+				break;
 			case 'h':
 				opts->help = 1;
 				break;
+			case 'H':
+				opts->heatmap = optarg;
+				break;
+			case 'm':
+				opts->shm = optarg;
+				break;
+			case 'o':
+				opts->record = optarg;
+				break;
+			case 'P':
+				opts->scenario = optarg;
+				break;
 			case 'r':
 				opts->rands = atol(optarg);
 				break;
 			case 's':
 				opts->speed = atoi(optarg);
 				break;
+			case 'S':
+				opts->saver = 1;
+				break;
 			case 'V':
 				opts->version = 1;
 				break;
@@ -178,14 +432,22 @@ help(const char *invocation, FILE *where)
 	fprintf(where, "\t%s [OPTIONS...]\n\n", invocation);
 	fprintf(where, "OPTIONS\n");
 	fprintf(where, "\t-b\tuse black background color\n");
+	fprintf(where, "\t-c\tcompute each frame directly from the seed (seekable)\n");
 	fprintf(where, "\t-d\tdrops ratio (%"PRIu8" .. %"PRIu8", default: %"PRIu8")\n",
 		       	DROPS_FACTOR_MIN, DROPS_FACTOR_MAX, DROPS_FACTOR_DEF);
 	fprintf(where, "\t-e\terror ratio (%"PRIu8" .. %"PRIu8", default: %"PRIu8")\n", 
 			ERROR_FACTOR_MIN, ERROR_FACTOR_MAX, ERROR_FACTOR_DEF);
+	fprintf(where, "\t-E\tprint energy usage (requires readable RAPL counters) on exit\n");
+	fprintf(where, "\t-f\tframe to start at (implies -c)\n");
 	fprintf(where, "\t-h\tprint this help text and exit\n");
+	fprintf(where, "\t-H\twrite a heatmap of changed cells and bytes to the given file\n");
+	fprintf(where, "\t-m\talso write the output to a shared memory ring buffer of the given name\n");
+	fprintf(where, "\t-o\talso record the output to the given file\n");
+	fprintf(where, "\t-P\treplay the given scenario file headless and report timings\n");
 	fprintf(where, "\t-r\tseed for the random number generator\n");
 	fprintf(where, "\t-s\tspeed factor (%"PRIu8" .. %"PRIu8", default: %"PRIu8")\n", 
 			SPEED_FACTOR_MIN, SPEED_FACTOR_MAX, SPEED_FACTOR_DEF);
+	fprintf(where, "\t-S\tscreensaver mode: use the alternate screen, exit on any key\n");
 	fprintf(where, "\t-V\tprint version information and exit\n");
 }
 
@@ -229,6 +491,39 @@ clamp_uint8(uint8_t *val, uint8_t min, uint8_t max)
 	if (*val > max) { *val = max; return; }
 }
 
+/*
+ * Return the current time of the monotonic clock, in seconds.
+ */
+static double
+time_now()
+{
+	struct timespec ts = { 0 };
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / (double) NS_PER_SEC;
+}
+
+/*
+ * Mix the bits of the given value (splitmix64 finalizer).
+ */
+static uint64_t
+hash_mix(uint64_t x)
+{
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+	return x ^ (x >> 31);
+}
+
+/*
+ * Return a pseudo-random 32 bit value that only depends on the arguments,
+ * where `kind` is one of the HASH_* values, used to get independent values 
+ * for the same seed and counters `a` and `b` (for example frame and column).
+ */
+static uint32_t
+hash_at(uint64_t seed, uint8_t kind, uint64_t a, uint64_t b)
+{
+	return hash_mix(hash_mix(hash_mix(seed ^ kind) ^ a) ^ b) >> 32;
+}
+
 /*
  * Return a pseudo-random int in the range [min, max].
  */
@@ -379,218 +674,873 @@ mat_set_tsize(matrix_s *mat, int row, int col, uint8_t tsize)
 }
 
 //
-// Functions to create, manipulate and print a matrix
+// Functions to track where the output bytes go
 //
 
 /*
- * Randomly change some characters in the matrix.
+ * Creates or recreates (resizes) the heatmap for the given matrix,
+ * resetting all counters. Returns -1 on error (out of memory), 0 on success.
  */
-static void
-mat_glitch(matrix_s *mat, float fraction)
+static int
+heat_init(heatmap_s *heat, matrix_s *mat)
 {
-	int size = mat->rows * mat->cols;
-	int num = fraction * size;
+	uint16_t cols  = (mat->cols + HEATMAP_TILE_COLS - 1) / HEATMAP_TILE_COLS;
+	uint16_t rows  = (mat->rows + HEATMAP_TILE_ROWS - 1) / HEATMAP_TILE_ROWS;
+	size_t   tiles = cols * rows;
 
-	int row = 0;
-	int col = 0;
+	// keep the old memory around (to be freed later) if realloc() fails
+	uint16_t *prev = realloc(heat->prev, sizeof(*heat->prev) * mat->cols * mat->rows);
+	if (prev == NULL)
+	{
+		return -1;
+	}
+	heat->prev = prev;
 
-	for (int i = 0; i < num; ++i)
+	uint32_t *writes = realloc(heat->writes, sizeof(*heat->writes) * tiles);
+	if (writes == NULL)
 	{
-		row = rand() % mat->rows;
-		col = rand() % mat->cols;
-		mat_set_ascii(mat, row, col, rand_ascii());
+		return -1;
 	}
+	heat->writes = writes;
+
+	uint32_t *bytes = realloc(heat->bytes, sizeof(*heat->bytes) * tiles);
+	if (bytes == NULL)
+	{
+		return -1;
+	}
+	heat->bytes = bytes;
+
+	heat->mcols  = mat->cols;
+	heat->cols   = cols;
+	heat->rows   = rows;
+	heat->frames = 0;
+	heat->compared = 0;
+	heat->primed = 0;
+
+	memset(heat->prev,   0, sizeof(*heat->prev)   * mat->cols * mat->rows);
+	memset(heat->writes, 0, sizeof(*heat->writes) * tiles);
+	memset(heat->bytes,  0, sizeof(*heat->bytes)  * tiles);
+	return 0;
 }
 
 /*
- * Print the matrix to stdout.
+ * Account for the cell with the given index and value, which took the given
+ * number of bytes to print.
  */
 static void
-mat_print(matrix_s *mat)
+heat_count(heatmap_s *heat, int idx, uint16_t value, size_t bytes)
 {
-	uint16_t value = 0;
-	uint8_t  state = STATE_NONE;
-	size_t   size  = mat->cols * mat->rows;
+	int tile = (idx / heat->mcols / HEATMAP_TILE_ROWS) * heat->cols 
+		+ (idx % heat->mcols / HEATMAP_TILE_COLS);
 
-	for (int i = 0; i < size; ++i)
-	{
-		value = mat->data[i];
-		state = val_get_state(value);
+	heat->bytes[tile] += bytes;
 
-		// fputc() + fputs() is faster than one call to printf()
-		// TODO investigate if the *_unlocked functions are faster;
-		//      and also, if faster, are they safe to use here?
-
-		switch (state)
-		{
-			case STATE_NONE:
-				fputc(' ', stdout);
-				//fputc_unlocked(' ', stdout);
-				break;
-			case STATE_DROP:
-				fputs(colors[0], stdout);
-				fputc(val_get_ascii(value), stdout);
-				//fputc_unlocked(val_get_ascii(value), stdout);
-				break;
-			case STATE_TAIL:
-				fputs(colors[val_get_tsize(value)], stdout);
-				fputc(val_get_ascii(value), stdout);
-				//fputc_unlocked(val_get_ascii(value), stdout);
-				break;
-		}
+	if (value != heat->prev[idx])
+	{
+		// the first frame after heat_init() has nothing to compare to
+		heat->writes[tile] += heat->primed;
+		heat->prev[idx] = value;
 	}
-
-	fflush(stdout);
 }
 
 /*
- * Turn the specified cell into a DROP cell.
+ * Write the given per-tile counters, averaged over `frames`, to `where`.
  */
 static void
-mat_put_cell_drop(matrix_s *mat, int row, int col, int tsize)
+heat_write_grid(heatmap_s *heat, uint32_t *counts, uint32_t frames, FILE *where)
 {
-	mat_set_state(mat, row, col, STATE_DROP);
-	mat_set_tsize(mat, row, col, tsize);
+	for (int r = 0; r < heat->rows; ++r)
+	{
+		for (int c = 0; c < heat->cols; ++c)
+		{
+			fprintf(where, " %7.1f", 
+					frames ? counts[r * heat->cols + c] / (float) frames : 0.0);
+		}
+		fputc('\n', where);
+	}
 }
 
 /*
- * Turn the specified cell into a TAIL cell.
+ * Put the name of the heatmap's temporary file, which is written first and 
+ * then renamed, so readers never see a partial heatmap, into `temp`.
+ * Returns -1 if the name doesn't fit, otherwise 0.
  */
-static void
-mat_put_cell_tail(matrix_s *mat, int row, int col, int tsize, int tnext)
+static int
+heat_temp(heatmap_s *heat, char *temp, size_t len)
 {
-	float intensity = (float) tnext / (float) tsize; // 1 for end of trace, 0.x for beginning
-	int color = ceil((NUM_COLORS-1) * intensity);
-	mat_set_state(mat, row, col, STATE_TAIL);
-	mat_set_tsize(mat, row, col, color);
+	return snprintf(temp, len, "%s.tmp", heat->file) < len ? 0 : -1;
 }
 
 /*
- * Add a DROP, including its TAIL cells, to the matrix, 
- * starting from the specified position.
- *
- * TODO make it so it can also draw partial traces, where
- *      the drop is past the bottom row, but some of the
- *      tail cells are still inside the matrix
+ * Make sure the heatmap file can be written, by creating (and removing)
+ * its temporary file. Returns -1 if it can't, otherwise 0.
  */
-static void
-mat_add_drop(matrix_s *mat, int row, int col, int tsize)
+static int
+heat_test(heatmap_s *heat)
 {
-	for (int i = 0; i <= tsize; ++i, --row)
+	char temp[4096];
+	if (heat_temp(heat, temp, sizeof(temp)) == -1)
 	{
-		if (row < 0)          break;
-		if (row >= mat->rows) continue;
+		return -1;
+	}
 
-		if (i == 0)
-		{
-			mat_put_cell_drop(mat, row, col, tsize);
-			mat->drop_count += 1;
-		}
-		else
-		{
-			mat_put_cell_tail(mat, row, col, tsize, i);
-		}
+	FILE *fp = fopen(temp, "w");
+	if (fp == NULL)
+	{
+		return -1;
 	}
+
+	fclose(fp);
+	remove(temp);
+	return 0;
 }
 
 /*
- * Make it rain by randomly adding DROPs to the matrix, based on the 
- * drop_ratio of the given matrix.
- *
- * TODO a nicer implementation would be to base the number of drops 
- *      to add on the drop_count field; however, we then also need to
- *      make sure that we reset this field to 0 on matrix resize and 
- *      before calling this function.
+ * Write the accumulated counters to the heatmap file and reset them. 
+ * Returns -1 if the file could not be written, otherwise 0.
  */
-static void
-mat_rain(matrix_s *mat)
+static int
+heat_write(heatmap_s *heat)
 {
-	int num = (int) (mat->cols * mat->rows) * mat->drop_ratio;
-
-	int c = 0;
-	int r = 0;
+	char temp[4096];
+	FILE *fp = heat_temp(heat, temp, sizeof(temp)) == 0 ? fopen(temp, "w") : NULL;
+	int  err = fp == NULL;
 
-	for (int i = 0; i < num; ++i)
+	if (fp)
 	{
-		c = rand_int(0, mat->cols - 1);
-		r = rand_int(0, mat->rows - 1);
-		mat_add_drop(mat, r, c, rand_int(TSIZE_MIN, TSIZE_MAX));
+		fprintf(fp, "# %s heatmap, frames %"PRIu64" to %"PRIu64", "
+				"%"PRIu16" x %"PRIu16" tiles of %d x %d cells\n", 
+				PROGRAM_NAME, heat->first, heat->first + heat->frames - 1, 
+				heat->cols, heat->rows, HEATMAP_TILE_COLS, HEATMAP_TILE_ROWS);
+		fprintf(fp, "# changed cells per tile and frame\n");
+		heat_write_grid(heat, heat->writes, heat->compared, fp);
+		fprintf(fp, "# bytes per tile and frame\n");
+		heat_write_grid(heat, heat->bytes, heat->frames, fp);
+		err = fclose(fp) != 0 || rename(temp, heat->file) != 0;
 	}
+
+	heat->frames = 0;
+	heat->compared = 0;
+	memset(heat->writes, 0, sizeof(*heat->writes) * heat->cols * heat->rows);
+	memset(heat->bytes,  0, sizeof(*heat->bytes)  * heat->cols * heat->rows);
+	return err ? -1 : 0;
 }
 
 /*
- * Move every cell down one row, potentially adding a new tail cell at the top.
- * Returns 1 if a DROP 'fell off the bottom', otherwise 0.
+ * Finish accounting for a frame. Once HEATMAP_FRAMES frames have been 
+ * accumulated, write the heatmap file and reset the counters.
+ * Returns -1 if the file could not be written, otherwise 0.
  */
 static int
-mat_mov_col(matrix_s *mat, int col)
+heat_frame(heatmap_s *heat, uint64_t frame)
 {
-	uint8_t tail_size = 0;
-	uint8_t tail_seen = 0;
-
-	uint16_t value = 0;
-	uint8_t  state = STATE_NONE;
-	uint8_t  tsize = 0;
-
-	// manually check the bottom-most cell: is it a DROP?
-	int dropped = mat_get_state(mat, mat->rows - 1, col) == STATE_DROP;
-
-	// iterate all cells in this column, moving each down one cell
-	for (int row = mat->rows - 1; row >= 0; --row)
+	if (heat->frames++ == 0)
 	{
-		// get the current cell's meta data
-		value = mat_get_value(mat, row, col);
-		state = val_get_state(value);
-		tsize = val_get_tsize(value);
+		heat->first = frame;
+	}
 
-		// nothing to do if this cell is neither DROP nor TAIL
-		if (state == STATE_NONE)
-		{
-			continue;
-		}
+	// from now on, changes can be counted against the previous frame
+	heat->compared += heat->primed;
+	heat->primed = 1;
 
-		// move the cell one down
-		mat_set_state(mat, row+1, col, state);
-		mat_set_tsize(mat, row+1, col, tsize);
+	return heat->frames < HEATMAP_FRAMES ? 0 : heat_write(heat);
+}
 
-		// null the current cell
-		mat_set_state(mat, row, col, STATE_NONE);
-		mat_set_tsize(mat, row, col, 0);
+/*
+ * Free the heatmap's memory.
+ */
+static void
+heat_free(heatmap_s *heat)
+{
+	free(heat->prev);
+	free(heat->writes);
+	free(heat->bytes);
+}
 
-		// keep track of the tail length of the last seen drop
-		if (state == STATE_DROP)
-		{
-			// remember the tail size to draw for this drop
-			tail_size = tsize;
-			tail_seen = 0;
-		}
-		else if (state == STATE_TAIL && tail_size > 0)
-		{
-			// keep track of how many tail cells we've seen
-			++tail_seen;
-		}
+//
+// Functions to hand the encoded frames to one or more sinks
+//
+
+/*
+ * Make sure the given buffer can hold at least `need` bytes, growing it if
+ * required. Returns -1 on error (out of memory), 0 on success.
+ */
+static int
+buf_reserve(char **buf, size_t *cap, size_t need)
+{
+	if (need <= *cap)
+	{
+		return 0;
 	}
 
-	// if the top-most cell wasn't empty, we might have to add a tail cell
-	if (state != STATE_NONE && tail_seen < tail_size)
+	// at least double the capacity, so that we don't have to grow often
+	size_t size = need > *cap * 2 ? need : *cap * 2;
+	char *grown = realloc(*buf, size);
+	if (grown == NULL)
 	{
-		mat_put_cell_tail(mat, 0, col, tail_size, tail_seen + 1); 
+		return -1;
 	}
 
-	return dropped;
+	*buf = grown;
+	*cap = size;
+	return 0;
 }
 
 /*
- * Update the matrix by moving all drops down one cell and potentially 
- * adding new drops at the top of the matrix.
+ * Write all of the given bytes to the file descriptor, retrying on partial
+ * writes and interruptions. Returns -1 on error, 0 on success.
  */
-static void 
-mat_update(matrix_s *mat)
+static int
+fd_write_all(int fd, const char *buf, size_t len)
 {
-	// move each column down one cell, possibly dropping some drops
-	for (int col = 0; col < mat->cols; ++col)
+	ssize_t num = 0;
+	while (len > 0)
 	{
-		mat->drop_count -= mat_mov_col(mat, col);
+		num = write(fd, buf, len);
+		if (num == -1)
+		{
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		buf += num;
+		len -= num;
+	}
+	return 0;
+}
+
+/*
+ * Writer thread of a file sink: swaps the sink's backlog for an empty 
+ * buffer and writes it to disk, without holding the lock, until told to 
+ * finish and all of the backlog has been written.
+ */
+static void *
+sink_writer(void *arg)
+{
+	sink_s *sink = arg;
+	char   *out  = NULL;
+	size_t  cap  = 0;
+	size_t  len  = 0;
+	char   *buf  = NULL;
+	size_t  size = 0;
+
+	pthread_mutex_lock(&sink->lock);
+	for (;;)
+	{
+		while (sink->len == 0 && !sink->done)
+		{
+			pthread_cond_wait(&sink->cond, &sink->lock);
+		}
+		if (sink->len == 0 && sink->done)
+		{
+			break;
+		}
+
+		// take the backlog, leave our (already written) buffer in its place
+		buf = sink->buf;
+		size = sink->cap;
+		len = sink->len;
+		sink->buf = out;
+		sink->cap = cap;
+		sink->len = 0;
+		out = buf;
+		cap = size;
+
+		pthread_mutex_unlock(&sink->lock);
+		int err = sink->err ? 0 : fd_write_all(sink->fd, out, len) == -1 ? errno : 0;
+		pthread_mutex_lock(&sink->lock);
+
+		// remember the first error, so it can be reported later on
+		if (err && !sink->err)
+		{
+			sink->err = err;
+		}
+	}
+	pthread_mutex_unlock(&sink->lock);
+
+	free(out);
+	return NULL;
+}
+
+/*
+ * Add the tty sink, which writes frames to stdout.
+ */
+static void
+sink_open_tty(sink_s *sink)
+{
+	sink->type = SINK_TTY;
+}
+
+/*
+ * Append an asciicast event of the given type ("o" for output, "r" for 
+ * resize) with the given data, JSON encoded, to the backlog of the file 
+ * sink. The caller has to hold the sink's lock (or be the only thread). 
+ * Returns -1 on error (out of memory), 0 on success.
+ */
+static int
+sink_event(sink_s *sink, const char *type, const char *data, size_t len)
+{
+	// worst case: every byte becomes a \u00XX escape sequence
+	if (buf_reserve(&sink->buf, &sink->cap, sink->len + len * 6 + 64) == -1)
+	{
+		return -1;
+	}
+
+	char *pos = sink->buf + sink->len;
+	pos += sprintf(pos, "[%.6f, \"%s\", \"", time_now() - sink->start, type);
+
+	for (size_t i = 0; i < len; ++i)
+	{
+		if (data[i] == '"' || data[i] == '\\')
+		{
+			*pos++ = '\\';
+			*pos++ = data[i];
+		}
+		else if ((unsigned char) data[i] < 0x20 || data[i] == 0x7f)
+		{
+			pos += sprintf(pos, "\\u%04x", (unsigned char) data[i]);
+		}
+		else
+		{
+			*pos++ = data[i];
+		}
+	}
+
+	pos += sprintf(pos, "\"]\n");
+	sink->len = pos - sink->buf;
+	return 0;
+}
+
+/*
+ * Add a file sink that records all frames to the given file, in asciicast
+ * v2 format, for a terminal of the given size, starting with the given 
+ * prelude. Returns -1 on error, 0 on success.
+ */
+static int
+sink_open_file(sink_s *sink, const char *file, const char *prelude,
+		uint16_t cols, uint16_t rows)
+{
+	sink->type  = SINK_FILE;
+	sink->name  = file;
+	sink->start = time_now();
+	sink->fd    = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (sink->fd == -1)
+	{
+		return -1;
+	}
+
+	// the header goes straight into the backlog, the writer isn't running yet
+	char header[128];
+	int len = snprintf(header, sizeof(header), "{\"version\": 2, \"width\": %"PRIu16
+			", \"height\": %"PRIu16", \"timestamp\": %ld}\n", 
+			cols, rows, (long) time(NULL));
+	if (buf_reserve(&sink->buf, &sink->cap, len) == -1)
+	{
+		close(sink->fd);
+		return -1;
+	}
+	memcpy(sink->buf, header, len);
+	sink->len = len;
+
+	if (sink_event(sink, "o", prelude, strlen(prelude)) == -1)
+	{
+		close(sink->fd);
+		free(sink->buf);
+		return -1;
+	}
+
+	pthread_mutex_init(&sink->lock, NULL);
+	pthread_cond_init(&sink->cond, NULL);
+
+	// the main thread should be the one to handle all signals
+	sigset_t all, old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	int err = pthread_create(&sink->thread, NULL, sink_writer, sink);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (err)
+	{
+		close(sink->fd);
+		free(sink->buf);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Begin (`begin` is 1) or end (`begin` is 0) an update of the ring buffer,
+ * by making the sequence counter odd or even again, respectively.
+ */
+static void
+ring_seq(ring_s *ring, int begin)
+{
+	if (begin)
+	{
+		// the odd counter has to be visible before any of the data writes
+		__atomic_store_n(&ring->seq, ring->seq + 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+	}
+	else
+	{
+		// and all data writes have to be visible before the even counter
+		__atomic_store_n(&ring->seq, ring->seq + 1, __ATOMIC_RELEASE);
+	}
+}
+
+/*
+ * Add a shm sink that copies all frames, of the given size, into a ring 
+ * buffer in the shared memory object of the given name. 
+ * Returns -1 on error, 0 on success.
+ */
+static int
+sink_open_shm(sink_s *sink, const char *name, uint16_t cols, uint16_t rows)
+{
+	sink->type = SINK_SHM;
+	sink->name = name;
+
+	// never touch an existing object, so that unlinking it later is safe
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (fd == -1)
+	{
+		return -1;
+	}
+
+	int err = 0;
+	size_t size = sizeof(ring_s) + SHM_RING_SIZE;
+	if (ftruncate(fd, size) == -1)
+	{
+		err = errno;
+		close(fd);
+		shm_unlink(name);
+		errno = err;
+		return -1;
+	}
+
+	sink->ring = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	err = errno;
+	close(fd);
+	if (sink->ring == MAP_FAILED)
+	{
+		sink->ring = NULL;
+		shm_unlink(name);
+		errno = err;
+		return -1;
+	}
+
+	memcpy(sink->ring->magic, SHM_RING_MAGIC, sizeof(sink->ring->magic));
+	sink->ring->size   = SHM_RING_SIZE;
+	sink->ring->seq    = 0;
+	sink->ring->cols   = cols;
+	sink->ring->rows   = rows;
+	sink->ring->head   = 0;
+	sink->ring->last   = 0;
+	sink->ring->frames = 0;
+	return 0;
+}
+
+/*
+ * Hand the given frame to the sink. Only the tty sink may block.
+ */
+static void
+sink_write(sink_s *sink, const char *frame, size_t len)
+{
+	ring_s  *ring = sink->ring;
+	uint64_t head = 0;
+	size_t   off  = 0;
+	size_t   num  = 0;
+
+	switch (sink->type)
+	{
+		case SINK_TTY:
+			fwrite(frame, 1, len, stdout);
+			fflush(stdout);
+			break;
+
+		case SINK_FILE:
+			pthread_mutex_lock(&sink->lock);
+			if (sink->err)
+			{
+				// writing failed before, no point in piling up frames
+			}
+			else if (sink->len + len > SINK_BACKLOG_MAX || 
+					sink_event(sink, "o", frame, len) == -1)
+			{
+				// the disk can't keep up, skip this frame
+				sink->dropped += 1;
+			}
+			else
+			{
+				pthread_cond_signal(&sink->cond);
+			}
+			pthread_mutex_unlock(&sink->lock);
+			break;
+
+		case SINK_SHM:
+			if (len > ring->size)
+			{
+				sink->dropped += 1;
+				break;
+			}
+			head = ring->head;
+			off  = head % ring->size;
+			num  = len < ring->size - off ? len : ring->size - off;
+
+			ring_seq(ring, 1);
+			memcpy(ring->data + off, frame, num);
+			memcpy(ring->data, frame + num, len - num);
+			ring->last    = head;
+			ring->head    = head + len;
+			ring->frames += 1;
+			ring_seq(ring, 0);
+			break;
+	}
+}
+
+/*
+ * Let the sink know that the terminal has been resized. Recordings and the
+ * shared memory ring buffer store the size along with the frames.
+ */
+static void
+sink_resize(sink_s *sink, uint16_t cols, uint16_t rows)
+{
+	char size[16];
+	int  len = snprintf(size, sizeof(size), "%"PRIu16"x%"PRIu16, cols, rows);
+
+	switch (sink->type)
+	{
+		case SINK_FILE:
+			pthread_mutex_lock(&sink->lock);
+			if (!sink->err && sink_event(sink, "r", size, len) == 0)
+			{
+				pthread_cond_signal(&sink->cond);
+			}
+			pthread_mutex_unlock(&sink->lock);
+			break;
+
+		case SINK_SHM:
+			ring_seq(sink->ring, 1);
+			sink->ring->cols = cols;
+			sink->ring->rows = rows;
+			ring_seq(sink->ring, 0);
+			break;
+	}
+}
+
+/*
+ * Flush and close the sink. For file sinks, this restores the font and 
+ * cursor at the end of the recording and waits for the writer thread to 
+ * write the remaining backlog.
+ */
+static void
+sink_close(sink_s *sink)
+{
+	switch (sink->type)
+	{
+		case SINK_FILE:
+			pthread_mutex_lock(&sink->lock);
+			if (!sink->err)
+			{
+				sink_event(sink, "o", ANSI_FONT_RESET ANSI_SHOW_CURSOR,
+						sizeof(ANSI_FONT_RESET ANSI_SHOW_CURSOR) - 1);
+			}
+			sink->done = 1;
+			pthread_cond_signal(&sink->cond);
+			pthread_mutex_unlock(&sink->lock);
+			pthread_join(sink->thread, NULL);
+			pthread_mutex_destroy(&sink->lock);
+			pthread_cond_destroy(&sink->cond);
+			close(sink->fd);
+			free(sink->buf);
+			break;
+
+		case SINK_SHM:
+			munmap(sink->ring, sizeof(ring_s) + SHM_RING_SIZE);
+			shm_unlink(sink->name);
+			break;
+	}
+
+	if (sink->dropped)
+	{
+		fprintf(stderr, "%s: dropped %zu frames\n", sink->name, sink->dropped);
+	}
+	if (sink->err)
+	{
+		fprintf(stderr, "%s: write error: %s\n", sink->name, strerror(sink->err));
+	}
+}
+
+/*
+ * Hand the encoded frame to all sinks of the output.
+ */
+static void
+out_write(output_s *out)
+{
+	for (int i = 0; i < out->num_sinks; ++i)
+	{
+		sink_write(&out->sinks[i], out->buf, out->len);
+	}
+}
+
+/*
+ * Let all sinks of the output know about the new terminal size.
+ */
+static void
+out_resize(output_s *out, uint16_t cols, uint16_t rows)
+{
+	for (int i = 0; i < out->num_sinks; ++i)
+	{
+		sink_resize(&out->sinks[i], cols, rows);
+	}
+}
+
+/*
+ * Close all sinks and free the output's memory.
+ */
+static void
+out_free(output_s *out)
+{
+	for (int i = 0; i < out->num_sinks; ++i)
+	{
+		sink_close(&out->sinks[i]);
+	}
+	free(out->buf);
+}
+
+//
+// Functions to create, manipulate and print a matrix
+//
+
+/*
+ * Randomly change some characters in the matrix.
+ */
+static void
+mat_glitch(matrix_s *mat, float fraction)
+{
+	int size = mat->rows * mat->cols;
+	int num = fraction * size;
+
+	int row = 0;
+	int col = 0;
+
+	for (int i = 0; i < num; ++i)
+	{
+		row = rand() % mat->rows;
+		col = rand() % mat->cols;
+		mat_set_ascii(mat, row, col, rand_ascii());
+	}
+}
+
+/*
+ * Encode the matrix once and hand it to all of the output's sinks. 
+ * If a heatmap is given, account for every cell.
+ * Returns -1 on error (out of memory), 0 on success.
+ */
+static int
+mat_print(matrix_s *mat, heatmap_s *heat, output_s *out)
+{
+	uint16_t value = 0;
+	uint8_t  state = STATE_NONE;
+	size_t   size  = mat->cols * mat->rows;
+	char    *color = NULL;
+	char    *cell  = NULL;
+
+	// make room for the worst case, so we don't have to check in the loop
+	size_t   clen  = 0;
+	for (int i = 0; i < NUM_COLORS; ++i)
+	{
+		clen = strlen(colors[i]) > clen ? strlen(colors[i]) : clen;
+	}
+	if (buf_reserve(&out->buf, &out->cap, 
+				sizeof(ANSI_CURSOR_RESET) + size * (clen + 1)) == -1)
+	{
+		return -1;
+	}
+
+	// every frame starts by moving the cursor back to the top left
+	memcpy(out->buf, ANSI_CURSOR_RESET, sizeof(ANSI_CURSOR_RESET) - 1);
+	char *pos = out->buf + sizeof(ANSI_CURSOR_RESET) - 1;
+
+	for (int i = 0; i < size; ++i)
+	{
+		value = mat->data[i];
+		state = val_get_state(value);
+		cell  = pos;
+
+		switch (state)
+		{
+			case STATE_NONE:
+				*pos++ = ' ';
+				break;
+			case STATE_DROP:
+			case STATE_TAIL:
+				color = colors[state == STATE_DROP ? 0 : val_get_tsize(value)];
+				while (*color)
+				{
+					*pos++ = *color++;
+				}
+				*pos++ = val_get_ascii(value);
+				break;
+		}
+
+		if (heat)
+		{
+			heat_count(heat, i, value, pos - cell);
+		}
+	}
+
+	out->len = pos - out->buf;
+	out_write(out);
+	return 0;
+}
+
+/*
+ * Turn the specified cell into a DROP cell.
+ */
+static void
+mat_put_cell_drop(matrix_s *mat, int row, int col, int tsize)
+{
+	mat_set_state(mat, row, col, STATE_DROP);
+	mat_set_tsize(mat, row, col, tsize);
+}
+
+/*
+ * Turn the specified cell into a TAIL cell.
+ */
+static void
+mat_put_cell_tail(matrix_s *mat, int row, int col, int tsize, int tnext)
+{
+	float intensity = (float) tnext / (float) tsize; // 1 for end of trace, 0.x for beginning
+	int color = ceil((NUM_COLORS-1) * intensity);
+	mat_set_state(mat, row, col, STATE_TAIL);
+	mat_set_tsize(mat, row, col, color);
+}
+
+/*
+ * Add a DROP, including its TAIL cells, to the matrix, 
+ * starting from the specified position.
+ *
+ * TODO make it so it can also draw partial traces, where
+ *      the drop is past the bottom row, but some of the
+ *      tail cells are still inside the matrix
+ */
+static void
+mat_add_drop(matrix_s *mat, int row, int col, int tsize)
+{
+	for (int i = 0; i <= tsize; ++i, --row)
+	{
+		if (row < 0)          break;
+		if (row >= mat->rows) continue;
+
+		if (i == 0)
+		{
+			mat_put_cell_drop(mat, row, col, tsize);
+			mat->drop_count += 1;
+		}
+		else
+		{
+			mat_put_cell_tail(mat, row, col, tsize, i);
+		}
+	}
+}
+
+/*
+ * Make it rain by randomly adding DROPs to the matrix, based on the 
+ * drop_ratio of the given matrix.
+ *
+ * TODO a nicer implementation would be to base the number of drops 
+ *      to add on the drop_count field; however, we then also need to
+ *      make sure that we reset this field to 0 on matrix resize and 
+ *      before calling this function.
+ */
+static void
+mat_rain(matrix_s *mat)
+{
+	int num = (int) (mat->cols * mat->rows) * mat->drop_ratio;
+
+	int c = 0;
+	int r = 0;
+
+	for (int i = 0; i < num; ++i)
+	{
+		c = rand_int(0, mat->cols - 1);
+		r = rand_int(0, mat->rows - 1);
+		mat_add_drop(mat, r, c, rand_int(TSIZE_MIN, TSIZE_MAX));
+	}
+}
+
+/*
+ * Move every cell down one row, potentially adding a new tail cell at the top.
+ * Returns 1 if a DROP 'fell off the bottom', otherwise 0.
+ */
+static int
+mat_mov_col(matrix_s *mat, int col)
+{
+	uint8_t tail_size = 0;
+	uint8_t tail_seen = 0;
+
+	uint16_t value = 0;
+	uint8_t  state = STATE_NONE;
+	uint8_t  tsize = 0;
+
+	// manually check the bottom-most cell: is it a DROP?
+	int dropped = mat_get_state(mat, mat->rows - 1, col) == STATE_DROP;
+
+	// iterate all cells in this column, moving each down one cell
+	for (int row = mat->rows - 1; row >= 0; --row)
+	{
+		// get the current cell's meta data
+		value = mat_get_value(mat, row, col);
+		state = val_get_state(value);
+		tsize = val_get_tsize(value);
+
+		// nothing to do if this cell is neither DROP nor TAIL
+		if (state == STATE_NONE)
+		{
+			continue;
+		}
+
+		// move the cell one down
+		mat_set_state(mat, row+1, col, state);
+		mat_set_tsize(mat, row+1, col, tsize);
+
+		// null the current cell
+		mat_set_state(mat, row, col, STATE_NONE);
+		mat_set_tsize(mat, row, col, 0);
+
+		// keep track of the tail length of the last seen drop
+		if (state == STATE_DROP)
+		{
+			// remember the tail size to draw for this drop
+			tail_size = tsize;
+			tail_seen = 0;
+		}
+		else if (state == STATE_TAIL && tail_size > 0)
+		{
+			// keep track of how many tail cells we've seen
+			++tail_seen;
+		}
+	}
+
+	// if the top-most cell wasn't empty, we might have to add a tail cell
+	if (state != STATE_NONE && tail_seen < tail_size)
+	{
+		mat_put_cell_tail(mat, 0, col, tail_size, tail_seen + 1); 
+	}
+
+	return dropped;
+}
+
+/*
+ * Update the matrix by moving all drops down one cell and potentially 
+ * adding new drops at the top of the matrix.
+ */
+static void 
+mat_update(matrix_s *mat)
+{
+	// move each column down one cell, possibly dropping some drops
+	for (int col = 0; col < mat->cols; ++col)
+	{
+		mat->drop_count -= mat_mov_col(mat, col);
 	}
 	
 	// add new drops at the top, trying to get to the desired drop count
@@ -598,59 +1548,557 @@ mat_update(matrix_s *mat)
 	int drops_missing = drops_desired - mat->drop_count; 
 	int drops_to_add  = ceil(drops_missing / (float) mat->rows);
 
-	for (int i = 0; i <= drops_to_add; ++i)
+	for (int i = 0; i <= drops_to_add; ++i)
+	{
+		mat_add_drop(mat, 0, rand_int(0, mat->cols - 1), 
+				rand_int(TSIZE_MIN, TSIZE_MAX));
+	}
+}
+
+/*
+ * Compute the matrix for the given frame directly from the seed, without 
+ * having to simulate any of the frames before it. Every column spawns a drop
+ * at the top with a probability of drop_ratio per frame and every cell gets 
+ * a new char once every 1 / error_ratio frames (at a random phase), which 
+ * gives about the same density and glitch rate as mat_update() and 
+ * mat_glitch(). Only drops that spawned within the last 2 * rows frames 
+ * can still be visible, so the cost does not depend on the frame number.
+ */
+static void
+mat_compute(matrix_s *mat, uint64_t seed, uint64_t frame, float error_ratio)
+{
+	uint32_t period = error_ratio > 0 ? 1.0 / error_ratio + 0.5 : UINT32_MAX;
+	uint32_t spawn  = mat->drop_ratio * UINT32_MAX;
+	uint32_t phase  = 0;
+	uint8_t  ascii  = 0;
+
+	// set all cells to their current char, with state STATE_NONE
+	for (int i = 0; i < mat->rows * mat->cols; ++i)
+	{
+		phase = hash_at(seed, HASH_PHASE, 0, i) % period;
+		ascii = hash_at(seed, HASH_ASCII, (frame + phase) / period, i) % ASCII_MAX;
+		mat->data[i] = val_new(ascii < ASCII_MIN ? ASCII_MIN : ascii, STATE_NONE, 0);
+	}
+
+	// add the drops, oldest first, so that newer ones overwrite older ones;
+	// like with mat_mov_col(), tails stop growing once the drop fell off
+	int tcap = mat->rows < TSIZE_MAX ? mat->rows : TSIZE_MAX;
+	uint64_t lookback = mat->rows + tcap;
+	uint64_t first = frame > lookback ? frame - lookback : 0;
+
+	uint64_t row   = 0;
+	uint8_t  tsize = 0;
+
+	mat->drop_count = 0;
+	for (uint64_t f = first; f <= frame; ++f)
+	{
+		for (int col = 0; col < mat->cols; ++col)
+		{
+			if (hash_at(seed, HASH_SPAWN, f, col) >= spawn)
+			{
+				continue;
+			}
+
+			row   = frame - f;
+			tsize = TSIZE_MIN + 
+				hash_at(seed, HASH_TSIZE, f, col) % (TSIZE_MAX - TSIZE_MIN + 1);
+
+			for (int i = 0; i <= tsize && i <= tcap && i <= row; ++i)
+			{
+				if (row - i >= mat->rows)
+				{
+					continue;
+				}
+				if (i == 0)
+				{
+					mat_put_cell_drop(mat, row, col, tsize);
+					mat->drop_count += 1;
+				}
+				else
+				{
+					mat_put_cell_tail(mat, row - i, col, tsize, i);
+				}
+			}
+		}
+	}
+}
+
+/*
+ * Fill the entire matrix with random characters, setting all cells to state
+ * STATE_NONE in the process.
+ */
+static void
+mat_fill(matrix_s *mat)
+{
+	for (int r = 0; r < mat->rows; ++r)
+	{
+		for (int c = 0; c < mat->cols; ++c)
+		{
+			mat_set_state(mat, r, c, STATE_NONE);
+			mat_set_ascii(mat, r, c, rand_ascii());
+		}
+	}
+}
+
+/*
+ * Creates or recreates (resizes) the given matrix.
+ * Returns -1 on error (out of memory), 0 on success.
+ */
+static int
+mat_init(matrix_s *mat, uint16_t rows, uint16_t cols, float drop_ratio)
+{
+	mat->data = realloc(mat->data, sizeof(mat->data) * rows * cols);
+	if (mat->data == NULL)
+	{
+		return -1;
+	}
+	++num_allocs;
+	
+	mat->rows = rows;
+	mat->cols = cols;
+
+	mat->drop_count = 0;
+	mat->drop_ratio = drop_ratio;
+	
+	return 0;
+}
+
+/*
+ * Free ALL the memory \o/
+ */
+void
+mat_free(matrix_s *mat)
+{
+	free(mat->data);
+}
+
+//
+// Functions to measure energy usage via RAPL
+//
+
+/*
+ * Read a single unsigned 64 bit value from the RAPL file with the given name
+ * for the given domain into `val`. Returns 0 on success, -1 on error.
+ */
+static int
+rapl_read(int domain, const char *name, uint64_t *val)
+{
+	char path[256];
+	snprintf(path, sizeof(path), "%s/intel-rapl:%d/%s", RAPL_PATH, domain, name);
+
+	FILE *fp = fopen(path, "r");
+	if (fp == NULL)
+	{
+		return -1;
+	}
+
+	int num = fscanf(fp, "%"SCNu64, val);
+	fclose(fp);
+	return num == 1 ? 0 : -1;
+}
+
+/*
+ * Check if the RAPL domain with the given index is a CPU package, that is,
+ * if its name starts with "package-". Returns 1 if so, otherwise 0.
+ */
+static int
+rapl_is_package(int domain)
+{
+	char path[256];
+	char name[32] = { 0 };
+	snprintf(path, sizeof(path), "%s/intel-rapl:%d/name", RAPL_PATH, domain);
+
+	FILE *fp = fopen(path, "r");
+	if (fp == NULL)
+	{
+		return 0;
+	}
+
+	int num = fscanf(fp, "%31s", name);
+	fclose(fp);
+	return num == 1 && strncmp(name, "package-", 8) == 0;
+}
+
+/*
+ * Find all readable RAPL package domains and take initial readings.
+ * Returns the number of domains found, which is 0 if RAPL is unavailable.
+ */
+static int
+rapl_init(rapl_s *rapl)
+{
+	rapl->domains = 0;
+	rapl->total   = 0;
+	rapl->sampled = time_now();
+
+	uint8_t n = 0;
+	for (int d = 0; d < RAPL_DOMAINS_MAX; ++d)
+	{
+		if (!rapl_is_package(d) || rapl_read(d, "energy_uj", &rapl->last[n]) == -1)
+		{
+			continue;
+		}
+		if (rapl_read(d, "max_energy_range_uj", &rapl->range[n]) == -1)
+		{
+			rapl->range[n] = 0;
+		}
+		rapl->index[n] = d;
+		rapl->domains = ++n;
+	}
+
+	return rapl->domains;
+}
+
+/*
+ * Read all RAPL counters and add the energy used since the last reading to
+ * the total, taking counter wrap around into account. Returns the total 
+ * energy used since rapl_init(), in microjoules.
+ */
+static uint64_t
+rapl_update(rapl_s *rapl)
+{
+	uint64_t now = 0;
+
+	rapl->sampled = time_now();
+
+	for (int d = 0; d < rapl->domains; ++d)
+	{
+		if (rapl_read(rapl->index[d], "energy_uj", &now) == -1)
+		{
+			continue;
+		}
+		if (now < rapl->last[d])
+		{
+			// without a known range, we can't tell how much has been used
+			if (rapl->range[d])
+			{
+				rapl->total += rapl->range[d] - rapl->last[d] + now;
+			}
+		}
+		else
+		{
+			rapl->total += now - rapl->last[d];
+		}
+		rapl->last[d] = now;
+	}
+
+	return rapl->total;
+}
+
+/*
+ * Read the RAPL counters if RAPL_SAMPLE_SECS have passed since the last 
+ * reading, so that a counter can't wrap around more than once unnoticed.
+ */
+static void
+rapl_poll(rapl_s *rapl)
+{
+	if (rapl->domains && time_now() - rapl->sampled >= RAPL_SAMPLE_SECS)
 	{
-		mat_add_drop(mat, 0, rand_int(0, mat->cols - 1), 
-				rand_int(TSIZE_MIN, TSIZE_MAX));
+		rapl_update(rapl);
 	}
 }
 
 /*
- * Fill the entire matrix with random characters, setting all cells to state
- * STATE_NONE in the process.
+ * Print the energy used over the given number of frames and seconds, as
+ * energy per frame and average power.
  */
 static void
-mat_fill(matrix_s *mat)
+rapl_report(rapl_s *rapl, uint64_t energy, uint32_t frames, double secs, FILE *where)
 {
-	for (int r = 0; r < mat->rows; ++r)
+	if (rapl->domains == 0)
 	{
-		for (int c = 0; c < mat->cols; ++c)
-		{
-			mat_set_state(mat, r, c, STATE_NONE);
-			mat_set_ascii(mat, r, c, rand_ascii());
-		}
+		fprintf(where, "energy: n/a (no readable RAPL counters)\n");
+		return;
 	}
+
+	fprintf(where, "energy: %.3f J, per frame: %.1f uJ, average: %.2f W\n",
+			energy / (double) UJ_PER_J,
+			frames ? energy / (double) frames : 0.0,
+			secs > 0 ? energy / (double) UJ_PER_J / secs : 0.0);
 }
 
+//
+// Functions to load and replay scenarios
+//
+
 /*
- * Creates or recreates (resizes) the given matrix.
- * Returns -1 on error (out of memory), 0 on success.
+ * Check if the matrix can be of the given size. Returns 1 if so, else 0.
  */
 static int
-mat_init(matrix_s *mat, uint16_t rows, uint16_t cols, float drop_ratio)
+scn_size_ok(unsigned int cols, unsigned int rows)
 {
-	mat->data = realloc(mat->data, sizeof(mat->data) * rows * cols);
-	if (mat->data == NULL)
+	return cols > 0 && rows > 0 && cols <= UINT16_MAX && rows <= UINT16_MAX &&
+		(unsigned long) cols * rows <= SCENARIO_CELLS_MAX;
+}
+
+/*
+ * Load the scenario from the given file into the provided scenario struct.
+ * Returns -1 if the file could not be opened, otherwise the line number of 
+ * the first invalid line, or 0 if the whole file has been read successfully.
+ */
+static int
+scn_load(const char *file, scenario_s *scn)
+{
+	FILE *fp = fopen(file, "r");
+	if (fp == NULL)
 	{
 		return -1;
 	}
-	
-	mat->rows = rows;
-	mat->cols = cols;
 
-	mat->drop_count = 0;
-	mat->drop_ratio = drop_ratio;
-	
+	scn->cols   = SCENARIO_COLS_DEF;
+	scn->rows   = SCENARIO_ROWS_DEF;
+	scn->frames = SCENARIO_FRAMES_DEF;
+
+	char line[256];
+	char name[16];
+	unsigned long frame = 0;
+	unsigned int  arg1  = 0;
+	unsigned int  arg2  = 0;
+	event_s *ev = NULL;
+
+	for (int lnum = 1; fgets(line, sizeof(line), fp); ++lnum)
+	{
+		if (line[0] == '#' || line[0] == '\n')
+		{
+			continue;
+		}
+
+		if (sscanf(line, "size %ux%u", &arg1, &arg2) == 2)
+		{
+			if (!scn_size_ok(arg1, arg2))
+			{
+				fclose(fp);
+				return lnum;
+			}
+			scn->cols = arg1;
+			scn->rows = arg2;
+			continue;
+		}
+
+		if (sscanf(line, "frames %lu", &frame) == 1)
+		{
+			if (frame > UINT32_MAX)
+			{
+				fclose(fp);
+				return lnum;
+			}
+			scn->frames = frame;
+			continue;
+		}
+
+		int num = sscanf(line, "at %lu %15s %ux%u", &frame, name, &arg1, &arg2);
+
+		// events need an argument, have to be in order and must fit
+		if (num < 3 || frame >= UINT32_MAX || scn->num_events == SCENARIO_EVENTS_MAX || 
+				(scn->num_events && frame < ev->frame))
+		{
+			fclose(fp);
+			return lnum;
+		}
+
+		ev = &scn->events[scn->num_events];
+		ev->frame = frame;
+		ev->type  = 0;
+		ev->arg1  = arg1 > UINT16_MAX ? UINT16_MAX : arg1;
+		ev->arg2  = num == 4 && arg2 <= UINT16_MAX ? arg2 : 0;
+
+		for (int i = 1; i < NUM_EVENT_NAMES; ++i)
+		{
+			if (strcmp(name, event_names[i]) == 0)
+			{
+				ev->type = i;
+				break;
+			}
+		}
+
+		// unknown event or resize without a valid size
+		if (ev->type == 0 || (ev->type == EVENT_RESIZE && 
+					(num != 4 || !scn_size_ok(arg1, arg2))))
+		{
+			fclose(fp);
+			return lnum;
+		}
+
+		scn->num_events += 1;
+	}
+
+	// make sure we run long enough to trigger all events
+	if (scn->num_events && scn->frames <= ev->frame)
+	{
+		scn->frames = ev->frame + 1;
+	}
+
+	fclose(fp);
 	return 0;
 }
 
 /*
- * Free ALL the memory \o/
+ * Stamp all events of the scenario that are due at the given frame with 
+ * the current time and energy counter, marking the start of a segment.
  */
-void
-mat_free(matrix_s *mat)
+static void
+scn_mark(scenario_s *scn, uint32_t frame, rapl_s *rapl)
 {
-	free(mat->data);
+	size_t i = scn->next_event;
+	if (i == scn->num_events || scn->events[i].frame != frame)
+	{
+		return;
+	}
+
+	double   stamp  = time_now();
+	uint64_t energy = rapl_update(rapl);
+
+	for (; i < scn->num_events && scn->events[i].frame == frame; ++i)
+	{
+		scn->events[i].stamp  = stamp;
+		scn->events[i].energy = energy;
+	}
+}
+
+/*
+ * Trigger all events of the scenario that are due at the given frame, 
+ * updating the window size and ratios accordingly. Returns the number 
+ * of events that have been triggered.
+ */
+static size_t
+scn_apply(scenario_s *scn, uint32_t frame, struct winsize *ws, 
+		float *drops_ratio, float *error_ratio)
+{
+	size_t   num = 0;
+	event_s *ev  = NULL;
+	uint8_t  val = 0;
+
+	for (; scn->next_event + num < scn->num_events; ++num)
+	{
+		ev = &scn->events[scn->next_event + num];
+		if (ev->frame != frame)
+		{
+			break;
+		}
+
+		switch (ev->type)
+		{
+			case EVENT_RESIZE:
+				ws->ws_col = ev->arg1;
+				ws->ws_row = ev->arg2;
+				raise(SIGWINCH);
+				break;
+			case EVENT_DROPS:
+				val = ev->arg1 > UINT8_MAX ? UINT8_MAX : ev->arg1;
+				clamp_uint8(&val, DROPS_FACTOR_MIN, DROPS_FACTOR_MAX);
+				*drops_ratio = DROPS_BASE_VALUE * val;
+				break;
+			case EVENT_ERROR:
+				val = ev->arg1 > UINT8_MAX ? UINT8_MAX : ev->arg1;
+				clamp_uint8(&val, ERROR_FACTOR_MIN, ERROR_FACTOR_MAX);
+				*error_ratio = ERROR_BASE_VALUE * val;
+				break;
+			case EVENT_WINCH:
+				for (int i = 0; i < ev->arg1; ++i)
+				{
+					raise(SIGWINCH);
+				}
+				break;
+		}
+	}
+
+	return num;
+}
+
+/*
+ * Store the measurements of the current frame with the first of the `num`
+ * events that have been triggered for it (the others share them), then 
+ * advance to the next pending event.
+ */
+static void
+scn_record(scenario_s *scn, size_t num, double latency, size_t allocs)
+{
+	if (num == 0)
+	{
+		return;
+	}
+	scn->events[scn->next_event].latency = latency;
+	scn->events[scn->next_event].allocs  = allocs;
+	scn->next_event += num;
+}
+
+/*
+ * Print the energy per frame and average power of a segment, that is the
+ * frames from one event up to the next one, which all share the same 
+ * configuration. Prints placeholders if no energy readings are available.
+ */
+static void
+scn_segment(rapl_s *rapl, uint32_t frames, double secs, uint64_t energy, FILE *where)
+{
+	if (rapl->domains == 0 || frames == 0 || secs <= 0)
+	{
+		fprintf(where, " %12s %8s\n", "-", "-");
+		return;
+	}
+
+	fprintf(where, " %12.1f %8.2f\n", energy / (double) frames,
+			energy / (double) UJ_PER_J / secs);
+}
+
+/*
+ * Print the per-event measurements as well as a summary of the whole run.
+ * The energy columns of each event cover all frames up to the next event.
+ * Events triggered in the same frame share one set of measurements, which
+ * is shown with the first of them, while the others only show placeholders.
+ */
+static void
+scn_report(scenario_s *scn, uint32_t frames, rapl_s *rapl, FILE *where)
+{
+	double   stamp  = time_now();
+	uint64_t energy = rapl_update(rapl);
+
+	char args[16];
+	event_s *ev = NULL;
+	event_s *nx = NULL;
+	size_t   n  = 0;
+
+	fprintf(where, "%8s  %-8s %-12s %12s %8s %12s %8s\n", "FRAME", "EVENT",
+			"ARGS", "LATENCY_US", "ALLOCS", "UJ_PER_FRAME", "WATTS");
+
+	// the segment from the start up to the first event
+	nx = scn->next_event ? &scn->events[0] : NULL;
+	snprintf(args, sizeof(args), "%"PRIu16"x%"PRIu16, scn->cols, scn->rows);
+	fprintf(where, "%8d  %-8s %-12s %12s %8s", 0, "start", args, "-", "-");
+	scn_segment(rapl, nx ? nx->frame : frames, (nx ? nx->stamp : stamp) - scn->stamp,
+			(nx ? nx->energy : energy) - scn->energy, where);
+
+	for (size_t i = 0; i < scn->next_event; ++i)
+	{
+		ev = &scn->events[i];
+		if (ev->type == EVENT_RESIZE)
+		{
+			snprintf(args, sizeof(args), "%"PRIu16"x%"PRIu16, ev->arg1, ev->arg2);
+		}
+		else
+		{
+			snprintf(args, sizeof(args), "%"PRIu16, ev->arg1);
+		}
+		if (i > 0 && scn->events[i - 1].frame == ev->frame)
+		{
+			fprintf(where, "%8"PRIu32"  %-8s %-12s %12s %8s %12s %8s\n", ev->frame,
+					event_names[ev->type], args, "-", "-", "-", "-");
+			continue;
+		}
+
+		fprintf(where, "%8"PRIu32"  %-8s %-12s %12.1f %8zu", ev->frame,
+				event_names[ev->type], args, ev->latency * US_PER_SEC, ev->allocs);
+
+		// find the next event that isn't triggered in the same frame
+		for (n = i + 1; n < scn->next_event && scn->events[n].frame == ev->frame; ++n);
+		nx = n < scn->next_event ? &scn->events[n] : NULL;
+		scn_segment(rapl, (nx ? nx->frame : frames) - ev->frame,
+				(nx ? nx->stamp : stamp) - ev->stamp,
+				(nx ? nx->energy : energy) - ev->energy, where);
+	}
+
+	double total = stamp - scn->stamp;
+	fprintf(where, "frames: %"PRIu32", total: %.3f s, per frame: %.1f us, allocs: %zu\n",
+			frames, total, frames ? total * US_PER_SEC / frames : 0.0, num_allocs);
+	rapl_report(rapl, energy - scn->energy, frames, total, where);
 }
 
 /*
@@ -669,27 +2117,50 @@ cli_wsize(struct winsize *ws)
 }
 
 /*
- * Turn echoing of keyboard input on/off.
+ * Save the terminal's input attributes, so they can be restored exactly, 
+ * then turn off echoing of keyboard input and, if `keys` is set, also 
+ * canonical (line by line) mode, so single key presses can be read.
  */
 static int
-cli_echo(int on)
+cli_input_setup(int keys)
 {
-	struct termios ta;
-	if (tcgetattr(STDIN_FILENO, &ta) != 0)
+	if (tcgetattr(STDIN_FILENO, &tattr) != 0)
 	{
 		return -1;
 	}
-	ta.c_lflag = on ? ta.c_lflag | ECHO : ta.c_lflag & ~ECHO;
+	tattr_saved = 1;
+
+	struct termios ta = tattr;
+	ta.c_lflag &= keys ? ~(ECHO | ICANON) : ~ECHO;
+	ta.c_cc[VMIN]  = keys ? 1 : ta.c_cc[VMIN];
+	ta.c_cc[VTIME] = keys ? 0 : ta.c_cc[VTIME];
 	return tcsetattr(STDIN_FILENO, TCSAFLUSH, &ta);
 }
 
 /*
- * Prepare the terminal for the next paint iteration.
+ * Restore the terminal's input attributes to what they were before
+ * cli_input_setup(), dropping any pending keyboard input.
  */
-static void
-cli_clear()
+static int
+cli_input_reset()
 {
-	fputs(ANSI_CURSOR_RESET, stdout);
+	if (!tattr_saved)
+	{
+		return -1;
+	}
+	return tcsetattr(STDIN_FILENO, TCSAFLUSH, &tattr);
+}
+
+/*
+ * Wait for the given amount of time or until a key has been pressed.
+ * Returns 1 if a key has been pressed, otherwise 0.
+ */
+static int
+cli_wait_key(struct timespec *ts)
+{
+	struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+	int ms = ts->tv_sec * 1000 + ts->tv_nsec / 1000000;
+	return poll(&pfd, 1, ms) > 0;
 }
 
 /*
@@ -698,6 +2169,13 @@ cli_clear()
 static void
 cli_setup(options_s *opts)
 {
+	// switching to the alternate screen also saves the cursor and font
+	// attributes, so this has to happen before we change any of them
+	if (opts->saver)
+	{
+		fputs(ANSI_ALT_SCREEN_ON, stdout); // keep the user's screen as is
+	}
+
 	fputs(ANSI_HIDE_CURSOR, stdout);
 	fputs(ANSI_FONT_BOLD, stdout);
 
@@ -706,9 +2184,13 @@ cli_setup(options_s *opts)
 		fputs(COLOR_BG, stdout);
 	}
 
-	fputs(ANSI_CLEAR_SCREEN, stdout); // clear screen
+	if (!opts->saver)
+	{
+		fputs(ANSI_CLEAR_SCREEN, stdout);  // clear screen
+	}
+
 	fputs(ANSI_CURSOR_RESET, stdout); // cursor back to position 0,0
-	cli_echo(0);                      // don't show keyboard input
+	cli_input_setup(opts->saver);     // no echo, single keys for screensaver
 	
 	// set the buffering to fully buffered, we're adult and flush ourselves
 	setvbuf(stdout, NULL, _IOFBF, 0);
@@ -718,13 +2200,24 @@ cli_setup(options_s *opts)
  * Make sure the terminal goes back to its normal state.
  */
 static void
-cli_reset()
+cli_reset(options_s *opts)
 {
 	fputs(ANSI_FONT_RESET, stdout);   // resets font colors and effects
 	fputs(ANSI_SHOW_CURSOR, stdout);  // show the cursor again
-	fputs(ANSI_CLEAR_SCREEN, stdout); // clear screen
-	fputs(ANSI_CURSOR_RESET, stdout); // cursor back to position 0,0
-	cli_echo(1);                      // show keyboard input
+
+	if (opts->saver)
+	{
+		// restores the user's screen, cursor and font attributes, hence last
+		fputs(ANSI_ALT_SCREEN_OFF, stdout);
+	}
+	else
+	{
+		fputs(ANSI_CLEAR_SCREEN, stdout);   // clear screen
+		fputs(ANSI_CURSOR_RESET, stdout);   // cursor back to position 0,0
+	}
+
+	fflush(stdout);
+	cli_input_reset();                // input as before, drop pending keys
 
 	setvbuf(stdout, NULL, _IOLBF, 0);
 }
@@ -784,7 +2277,8 @@ main(int argc, char **argv)
 
 	if (opts.rands == 0)
 	{
-		opts.rands = time(NULL);
+		// scenarios should replay the same way every time
+		opts.rands = opts.scenario ? 1 : time(NULL);
 	}
 	
 	// make sure the values are within expected/valid range
@@ -792,9 +2286,28 @@ main(int argc, char **argv)
 	clamp_uint8(&opts.drops, DROPS_FACTOR_MIN, DROPS_FACTOR_MAX);
 	clamp_uint8(&opts.error, ERROR_FACTOR_MIN, ERROR_FACTOR_MAX);
 
-	// get the terminal dimensions
+	// load the scenario, if any, which also dictates the matrix size
+	scenario_s scn = { 0 };
 	struct winsize ws = { 0 };
-	if (cli_wsize(&ws) == -1)
+	if (opts.scenario)
+	{
+		int err = scn_load(opts.scenario, &scn);
+		if (err == -1)
+		{
+			fprintf(stderr, "Failed to open scenario file\n");
+			return EXIT_FAILURE;
+		}
+		if (err > 0)
+		{
+			fprintf(stderr, "Invalid scenario file, line %d\n", err);
+			return EXIT_FAILURE;
+		}
+		ws.ws_col = scn.cols;
+		ws.ws_row = scn.rows;
+	}
+
+	// get the terminal dimensions
+	else if (cli_wsize(&ws) == -1)
 	{
 		fprintf(stderr, "Failed to determine terminal size\n");
 		return EXIT_FAILURE;
@@ -821,36 +2334,235 @@ main(int argc, char **argv)
 
 	// initialize the matrix
 	matrix_s mat = { 0 }; 
-	mat_init(&mat, ws.ws_row, ws.ws_col, drops_ratio);
+	if (mat_init(&mat, ws.ws_row, ws.ws_col, drops_ratio) == -1)
+	{
+		fprintf(stderr, "Failed to allocate matrix\n");
+		return EXIT_FAILURE;
+	}
 	mat_fill(&mat);
 
-	// prepare the terminal for our shenanigans
-	cli_setup(&opts);
+	// as a screensaver, the very first frame should already be full of rain
+	if (opts.saver)
+	{
+		if (opts.seekable && opts.frame == 0)
+		{
+			opts.frame = 2 * mat.rows;
+		}
+		else if (!opts.seekable)
+		{
+			mat_rain(&mat);
+		}
+	}
+
+	// set up the heatmap, if requested
+	heatmap_s heat = { .file = opts.heatmap };
+	heatmap_s *hmap = opts.heatmap ? &heat : NULL;
+	if (hmap && heat_test(hmap) == -1)
+	{
+		fprintf(stderr, "Failed to write heatmap file\n");
+		return EXIT_FAILURE;
+	}
+	if (hmap && heat_init(hmap, &mat) == -1)
+	{
+		fprintf(stderr, "Failed to allocate heatmap\n");
+		return EXIT_FAILURE;
+	}
+	const char *fail = NULL;      // error to report on exit
+
+	// set up the sinks: terminal (or stdout), recording, shared memory
+	output_s out = { 0 };
+	sink_open_tty(&out.sinks[out.num_sinks++]);
+
+	if (opts.record)
+	{
+		char prelude[64];
+		snprintf(prelude, sizeof(prelude), "%s%s%s%s", ANSI_HIDE_CURSOR,
+				ANSI_FONT_BOLD, opts.bg ? COLOR_BG : "", ANSI_CLEAR_SCREEN);
+		if (sink_open_file(&out.sinks[out.num_sinks], opts.record, prelude,
+					ws.ws_col, ws.ws_row) == -1)
+		{
+			fprintf(stderr, "Failed to open recording file\n");
+			out_free(&out);
+			return EXIT_FAILURE;
+		}
+		out.num_sinks += 1;
+	}
+
+	if (opts.shm)
+	{
+		if (sink_open_shm(&out.sinks[out.num_sinks], opts.shm, 
+					ws.ws_col, ws.ws_row) == -1)
+		{
+			fprintf(stderr, "Failed to set up shared memory ring buffer: %s\n",
+					strerror(errno));
+			out_free(&out);
+			return EXIT_FAILURE;
+		}
+		out.num_sinks += 1;
+	}
+
+	// prepare the terminal for our shenanigans, unless we're headless
+	if (opts.scenario)
+	{
+		setvbuf(stdout, NULL, _IOFBF, 0);
+	}
+	else
+	{
+		cli_setup(&opts);
+	}
+
+	// look for energy counters, only if we're going to report on them
+	rapl_s rapl = { 0 };
+	if (opts.scenario || opts.energy)
+	{
+		rapl_init(&rapl);
+	}
+
+	uint32_t frame  = 0;      // number of frames shown or replayed so far
+	size_t   events = 0;      // number of events triggered this frame
+	size_t   allocs = 0;      // number of allocations before this frame
+	double   begin  = 0;
+	double   start  = time_now();
+
+	if (opts.scenario)
+	{
+		scn.stamp  = start;
+		scn.energy = rapl_update(&rapl);
+	}
 
 	running = 1;
 	while(running)
 	{
+		if (opts.scenario)
+		{
+			if (frame == scn.frames)
+			{
+				break;
+			}
+
+			rapl_poll(&rapl);
+			scn_mark(&scn, frame, &rapl);
+			begin  = time_now();
+			allocs = num_allocs;
+			events = scn_apply(&scn, frame, &ws, &drops_ratio, &error_ratio);
+			mat.drop_ratio = drops_ratio;
+		}
+
 		if (resized)
 		{
-			// query the terminal size again
-			cli_wsize(&ws);
+			// query the terminal size again, unless the scenario set it
+			if (!opts.scenario)
+			{
+				cli_wsize(&ws);
+			}
 			
 			// reinitialize the matrix
-			mat_init(&mat, ws.ws_row, ws.ws_col, drops_ratio);
+			if (mat_init(&mat, ws.ws_row, ws.ws_col, drops_ratio) == -1)
+			{
+				fail = "Failed to allocate matrix";
+				break;
+			}
 			mat_fill(&mat);
-			mat_rain(&mat); // TODO maybe this isn't desired?
+			out_resize(&out, ws.ws_col, ws.ws_row);
+			if (hmap)
+			{
+				// the tiles change with the size, finish the current heatmap
+				if (heat.frames && heat_write(hmap) == -1)
+				{
+					fail = "Failed to write heatmap file";
+				}
+				if (heat_init(hmap, &mat) == -1)
+				{
+					fail = "Failed to allocate heatmap";
+					break;
+				}
+			}
+			if (!opts.seekable)
+			{
+				mat_rain(&mat); // TODO maybe this isn't desired?
+			}
 			resized = 0;
 		}
 
-		cli_clear();
-		mat_print(&mat);                // print to the terminal
-		mat_glitch(&mat, error_ratio);  // apply random defects
-		mat_update(&mat);               // move all drops down one row
+		if (opts.seekable)
+		{
+			// the whole frame only depends on the seed and frame number
+			mat_compute(&mat, opts.rands, opts.frame + frame, error_ratio);
+		}
+
+		// print to all sinks
+		if (mat_print(&mat, hmap, &out) == -1)
+		{
+			fail = "Failed to allocate frame buffer";
+			break;
+		}
+
+		if (hmap && heat_frame(hmap, opts.frame + frame) == -1)
+		{
+			fail = "Failed to write heatmap file";
+		}
+
+		if (!opts.seekable)
+		{
+			mat_glitch(&mat, error_ratio);  // apply random defects
+			mat_update(&mat);               // move all drops down one row
+		}
+		++frame;
+
+		if (opts.scenario)
+		{
+			// headless: record the measurements, but don't wait
+			scn_record(&scn, events, time_now() - begin, num_allocs - allocs);
+			continue;
+		}
+
+		// keep up with the energy counters, if we're going to report on them
+		rapl_poll(&rapl);
+
+		if (opts.saver)
+		{
+			// any key ends the screensaver
+			if (cli_wait_key(&ts))
+			{
+				running = 0;
+			}
+			continue;
+		}
+
 		nanosleep(&ts, NULL);
 	}
 
+	// write what's left of the heatmap, unless something went wrong
+	if (hmap && heat.frames && fail == NULL && heat_write(hmap) == -1)
+	{
+		fail = "Failed to write heatmap file";
+	}
+
 	// make sure all is back to normal before we exit
 	mat_free(&mat);	
-	cli_reset();
+	heat_free(&heat);
+	if (opts.scenario)
+	{
+		fflush(stdout);
+		out_free(&out);
+		scn_report(&scn, frame, &rapl, stderr);
+	}
+	else
+	{
+		cli_reset(&opts);
+		out_free(&out);
+	}
+
+	if (opts.energy && !opts.scenario)
+	{
+		// the accumulated energy starts at 0 with rapl_init()
+		rapl_report(&rapl, rapl_update(&rapl), frame, time_now() - start, stdout);
+	}
+
+	if (fail)
+	{
+		fprintf(stderr, "%s\n", fail);
+		return EXIT_FAILURE;
+	}
 	return EXIT_SUCCESS;
 }